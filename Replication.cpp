@@ -3,18 +3,423 @@
 #include "Replication/Replication.hpp"
 
 #include "apostol/application.hpp"
+#include "apostol/event_loop.hpp"
 #include "apostol/pg_utils.hpp"
 
 #include <fmt/format.h>
 #include <nlohmann/json.hpp>
 
+#include <openssl/evp.h>
+
 #include <algorithm>
+#include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 namespace apostol
 {
 
+namespace
+{
+
+std::int64_t elapsed_us(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - since).count();
+}
+
+// SHA-256 via OpenSSL (already linked for the HTTPS master connection).
+std::string sha256_hex(std::string_view data)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if (EVP_Digest(data.data(), data.size(), md, &len, EVP_sha256(), nullptr) != 1)
+        throw std::runtime_error("SHA-256 digest failed");
+
+    std::string hex;
+    hex.reserve(len * 2);
+    for (unsigned int i = 0; i < len; ++i)
+        fmt::format_to(std::back_inserter(hex), "{:02x}", md[i]);
+    return hex;
+}
+
+// Row-image columns whose large fields are deduplicated.
+bool is_row_image(std::string_view column)
+{
+    return column == "data" || column == "key";
+}
+
+// Top-level member of a JSON object text, as raw spans: [begin, end) is the
+// whole `"key": value`, [value, end) the value. Values are never reparsed, so
+// numerics keep their exact jsonb text.
+struct JsonMember
+{
+    std::string key;
+    std::size_t begin;
+    std::size_t value;
+    std::size_t end;
+};
+
+std::size_t skip_ws(std::string_view t, std::size_t i)
+{
+    while (i < t.size() && (t[i] == ' ' || t[i] == '\t' || t[i] == '\n' || t[i] == '\r'))
+        ++i;
+    return i;
+}
+
+// End of the string starting at t[i] == '"', or npos.
+std::size_t skip_string(std::string_view t, std::size_t i)
+{
+    for (++i; i < t.size(); ++i) {
+        if (t[i] == '\\')
+            ++i;
+        else if (t[i] == '"')
+            return i + 1;
+    }
+    return std::string_view::npos;
+}
+
+// End of the JSON value starting at t[i], or npos.
+std::size_t skip_value(std::string_view t, std::size_t i)
+{
+    if (i >= t.size())
+        return std::string_view::npos;
+
+    if (t[i] == '"')
+        return skip_string(t, i);
+
+    if (t[i] == '{' || t[i] == '[') {
+        int depth = 0;
+        while (i < t.size()) {
+            char ch = t[i];
+            if (ch == '"') {
+                i = skip_string(t, i);
+                if (i == std::string_view::npos)
+                    return i;
+                continue;
+            }
+            if (ch == '{' || ch == '[')
+                ++depth;
+            else if ((ch == '}' || ch == ']') && --depth == 0)
+                return i + 1;
+            ++i;
+        }
+        return std::string_view::npos;
+    }
+
+    // Scalar: number, true, false, null
+    auto start = i;
+    while (i < t.size() && t[i] != ',' && t[i] != '}' && t[i] != ']'
+           && t[i] != ' ' && t[i] != '\t' && t[i] != '\n' && t[i] != '\r')
+        ++i;
+    return i > start ? i : std::string_view::npos;
+}
+
+// Split a JSON object text into its top-level members. False if not an object.
+bool scan_object(std::string_view t, std::vector<JsonMember>& members)
+{
+    auto i = skip_ws(t, 0);
+    if (i >= t.size() || t[i] != '{')
+        return false;
+
+    i = skip_ws(t, i + 1);
+    if (i < t.size() && t[i] == '}')
+        return skip_ws(t, i + 1) == t.size();
+
+    while (i < t.size() && t[i] == '"') {
+        JsonMember m{};
+        m.begin = i;
+
+        auto key_end = skip_string(t, i);
+        if (key_end == std::string_view::npos)
+            return false;
+        auto key = nlohmann::json::parse(t.substr(i, key_end - i), nullptr, false);
+        if (!key.is_string())
+            return false;
+        m.key = key.get<std::string>();
+
+        i = skip_ws(t, key_end);
+        if (i >= t.size() || t[i] != ':')
+            return false;
+
+        m.value = skip_ws(t, i + 1);
+        m.end = skip_value(t, m.value);
+        if (m.end == std::string_view::npos)
+            return false;
+        members.push_back(std::move(m));
+
+        i = skip_ws(t, members.back().end);
+        if (i < t.size() && t[i] == ',') {
+            i = skip_ws(t, i + 1);
+            continue;
+        }
+        if (i < t.size() && t[i] == '}')
+            return skip_ws(t, i + 1) == t.size();
+        return false;
+    }
+
+    return false;
+}
+
+// Object text with `fields` ({key, raw value}) set: existing members are
+// replaced in place, new ones appended. Other members are copied verbatim.
+std::optional<std::string> splice_fields(std::string_view t,
+    const std::vector<std::pair<std::string, std::string>>& fields)
+{
+    std::vector<JsonMember> members;
+    if (!scan_object(t, members))
+        return std::nullopt;
+
+    std::string out = "{";
+    auto append = [&out](std::string_view part) {
+        if (out.size() > 1)
+            out += ", ";
+        out.append(part);
+    };
+
+    std::set<std::string> done;
+    for (auto& m : members) {
+        auto f = std::find_if(fields.begin(), fields.end(),
+                              [&m](const auto& kv) { return kv.first == m.key; });
+        if (f == fields.end()) {
+            append(t.substr(m.begin, m.end - m.begin));
+            continue;
+        }
+        append(nlohmann::json(f->first).dump() + ": " + f->second);
+        done.insert(f->first);
+    }
+
+    for (auto& [key, raw] : fields)
+        if (!done.count(key))
+            append(nlohmann::json(key).dump() + ": " + raw);
+
+    out += '}';
+    return out;
+}
+
+// Replace {"refs": {"<column>.<field>": hash}} in entries with the referenced
+// values (raw field text, spliced back into the column's jsonb text).
+// Looks in `fetched` ({hash: value}) first, then in the store. Returns the
+// hashes that could not be resolved (entries keep those refs).
+std::vector<std::string> resolve_refs(nlohmann::json& entries, ReplicationStore* store,
+                                      const nlohmann::json* fetched = nullptr)
+{
+    std::set<std::string> unresolved;
+
+    for (auto& entry : entries) {
+        if (!entry.is_object() || !entry.contains("refs") || !entry["refs"].is_object())
+            continue;
+
+        auto& refs = entry["refs"];
+
+        // column -> ({field, raw value}, refs covering it)
+        std::map<std::string, std::vector<std::pair<std::string, std::string>>> fields;
+        std::map<std::string, std::vector<std::string>> column_refs;
+
+        for (auto& [ref, h] : refs.items()) {
+            auto hash = h.is_string() ? h.get<std::string>() : std::string();
+
+            std::optional<std::string> value;
+            if (fetched && fetched->contains(hash) && (*fetched)[hash].is_string())
+                value = (*fetched)[hash].get<std::string>();
+            else if (store && !hash.empty())
+                value = store->get(hash);
+
+            auto dot = ref.find('.');
+            if (!value || dot == std::string::npos || !nlohmann::json::accept(*value)) {
+                unresolved.insert(hash);
+                continue;
+            }
+
+            auto column = ref.substr(0, dot);
+            fields[column].emplace_back(ref.substr(dot + 1), std::move(*value));
+            column_refs[column].push_back(ref);
+        }
+
+        for (auto& [column, values] : fields) {
+            auto text = entry.contains(column) && entry[column].is_string()
+                ? entry[column].get<std::string>() : std::string("{}");
+
+            auto patched = splice_fields(text, values);
+            if (!patched) {
+                for (auto& ref : column_refs[column])
+                    unresolved.insert(refs[ref].get<std::string>());
+                continue;
+            }
+
+            entry[column] = std::move(*patched);
+            for (auto& ref : column_refs[column])
+                refs.erase(ref);
+        }
+
+        if (refs.empty())
+            entry.erase("refs");
+    }
+
+    return {unresolved.begin(), unresolved.end()};
+}
+
+// Apply incoming batch using existing api.add_to_relay_log + api.replication_apply
+// When replication.apply_batch() is available, switch to that.
+std::string build_apply_sql(const nlohmann::json& entries, const std::string& session,
+                            const std::string& source)
+{
+    std::string sql = fmt::format("SELECT * FROM api.authorize({});\n",
+                                  pq_quote_literal(session));
+    for (auto& entry : entries) {
+        sql += fmt::format(
+            "SELECT * FROM api.add_to_relay_log({}, {}, {}::timestamptz, "
+            "{}::char, {}, {}, {}::jsonb, {}::jsonb, false);\n",
+            pq_quote_literal(entry.value("source", source)),
+            entry.value("id", 0),
+            pq_quote_literal(entry.value("datetime", "")),
+            pq_quote_literal(entry.value("action", "")),
+            pq_quote_literal(entry.value("schema", "")),
+            pq_quote_literal(entry.value("name", "")),
+            pq_quote_literal(entry.value("key", "null")),
+            pq_quote_literal(entry.value("data", "null")));
+    }
+
+    sql += fmt::format("SELECT * FROM api.replication_apply({});\n",
+                       pq_quote_literal(source));
+    return sql;
+}
+
+// Outgoing payload from outbox rows. Outbox is PgResult (live) or
+// RecordedOutbox (replay), so both run the same build stage.
+//
+// With `refs` (store open and the master confirmed dedup support), fields of
+// a row image of at least `threshold` bytes are sent as their hash: the hash
+// covers the field's raw jsonb text, so the same document on different rows
+// (or row versions) maps to one stored value.
+template <typename Outbox>
+std::string build_payload(const Outbox& outbox, const std::string& source,
+                          ReplicationStore* store, bool refs, std::size_t threshold)
+{
+    int count = outbox.rows();
+
+    nlohmann::json payload;
+    payload["source"] = source;
+    payload["entries"] = nlohmann::json::array();
+    if (store)
+        payload["dedup"] = threshold;  // peer may answer with refs too
+
+    for (int r = 0; r < count; ++r) {
+        nlohmann::json entry;
+        for (int c = 0; c < outbox.columns(); ++c) {
+            const char* col_name = outbox.column_name(c);
+            const char* val = outbox.value(r, c);
+            if (!col_name || !val)
+                continue;
+
+            // Large fields are cut out of the row text as raw spans; the
+            // rest of the row image is sent verbatim
+            std::string_view v(val);
+            std::vector<JsonMember> members;
+            if (refs && store && v.size() >= threshold && is_row_image(col_name)
+                && scan_object(v, members)) {
+                std::string kept = "{";
+                bool cut = false;
+                for (auto& m : members) {
+                    auto raw = v.substr(m.value, m.end - m.value);
+                    if (raw.size() >= threshold) {
+                        entry["refs"][std::string(col_name) + "." + m.key] = store->put(raw);
+                        cut = true;
+                        continue;
+                    }
+                    if (kept.size() > 1)
+                        kept += ", ";
+                    kept.append(v.substr(m.begin, m.end - m.begin));
+                }
+                kept += '}';
+
+                if (cut) {
+                    entry[col_name] = std::move(kept);
+                    continue;
+                }
+            }
+
+            entry[col_name] = val;
+        }
+        payload["entries"].push_back(std::move(entry));
+    }
+
+    return payload.dump();
+}
+
+// Outbox rows rebuilt from a recorded request payload, with the PgResult
+// accessors build_payload() needs. Refs are resolved from the store.
+class RecordedOutbox
+{
+public:
+    RecordedOutbox(std::string_view request, ReplicationStore* store)
+    {
+        auto j = nlohmann::json::parse(request);
+        auto entries = j.value("entries", nlohmann::json::array());
+        unresolved_ = resolve_refs(entries, store).size();
+
+        for (auto& entry : entries) {
+            if (!entry.is_object())
+                continue;
+
+            auto& row = values_.emplace_back();
+            for (auto& [key, value] : entry.items()) {
+                if (key == "refs")
+                    continue;
+
+                auto it = std::find(columns_.begin(), columns_.end(), key);
+                auto c = static_cast<std::size_t>(it - columns_.begin());
+                if (it == columns_.end())
+                    columns_.push_back(key);
+                if (row.size() <= c)
+                    row.resize(c + 1);
+                row[c] = value.is_string() ? value.get<std::string>() : value.dump();
+            }
+        }
+    }
+
+    /// Recorded refs that could not be resolved (fields missing from rows).
+    std::size_t unresolved() const { return unresolved_; }
+
+    int rows() const { return static_cast<int>(values_.size()); }
+    int columns() const { return static_cast<int>(columns_.size()); }
+
+    const char* column_name(int c) const { return columns_[c].c_str(); }
+
+    const char* value(int r, int c) const
+    {
+        auto& row = values_[r];
+        if (static_cast<std::size_t>(c) >= row.size() || !row[c])
+            return nullptr;
+        return row[c]->c_str();
+    }
+
+private:
+    std::vector<std::string> columns_;
+    std::vector<std::vector<std::optional<std::string>>> values_;
+    std::size_t unresolved_{0};
+};
+
+void add_phases(ReplicationCycle& total, const ReplicationCycle& c)
+{
+    total.outbox_us   += c.outbox_us;
+    total.build_us    += c.build_us;
+    total.transfer_us += c.transfer_us;
+    total.parse_us    += c.parse_us;
+    total.fetch_us    += c.fetch_us;
+    total.apply_us    += c.apply_us;
+}
+
+} // namespace
+
 // --- helpers -----------------------------------------------------------------
 
 ReplicationServer::SyncMode ReplicationServer::parse_mode(std::string_view s)
@@ -31,6 +436,15 @@ ReplicationServer::Channel ReplicationServer::parse_channel(std::string_view s)
     return Channel::lan;
 }
 
+std::string_view ReplicationServer::channel_name(Channel c)
+{
+    switch (c) {
+        case Channel::wifi:      return "wifi";
+        case Channel::satellite: return "satellite";
+        default:                 return "lan";
+    }
+}
+
 ReplicationServer::seconds ReplicationServer::current_interval() const
 {
     switch (channel_) {
@@ -55,6 +469,383 @@ bool ReplicationServer::token_valid() const
         && std::chrono::system_clock::now() < token_expires_;
 }
 
+bool ReplicationServer::remote_ready() const
+{
+    // Replay talks to a mock master -- no remote token needed, and a replay
+    // config that failed to start must never fall back to the real master
+    return !replay_file_.empty() || token_valid();
+}
+
+// --- ReplicationWorkers ------------------------------------------------------
+
+ReplicationWorkers::ReplicationWorkers(std::size_t threads, std::size_t max_queue)
+    : max_queue_(max_queue)
+    , event_fd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    threads_.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i)
+        threads_.emplace_back([this] { run(); });
+}
+
+ReplicationWorkers::~ReplicationWorkers()
+{
+    stop();
+    if (event_fd_ >= 0)
+        ::close(event_fd_);
+}
+
+bool ReplicationWorkers::submit(Job& job, Fail& fail)
+{
+    {
+        std::lock_guard lock(mutex_);
+        if (stopping_ || threads_.empty() || tasks_.size() >= max_queue_)
+            return false;
+        tasks_.push_back({std::move(job), std::move(fail)});
+    }
+    cv_.notify_one();
+    return true;
+}
+
+std::size_t ReplicationWorkers::drain()
+{
+    // Reset the eventfd counter before taking the queue: a continuation
+    // pushed after this point signals again and is not lost
+    if (event_fd_ >= 0) {
+        std::uint64_t counter;
+        [[maybe_unused]] ssize_t n = ::read(event_fd_, &counter, sizeof(counter));
+    }
+
+    std::deque<Continuation> ready;
+    {
+        std::lock_guard lock(mutex_);
+        ready.swap(done_);
+    }
+
+    for (auto& cont : ready)
+        if (cont) cont();
+
+    return ready.size();
+}
+
+void ReplicationWorkers::stop()
+{
+    {
+        std::lock_guard lock(mutex_);
+        if (stopping_)
+            return;
+        stopping_ = true;
+        tasks_.clear();
+    }
+    cv_.notify_all();
+
+    for (auto& t : threads_)
+        if (t.joinable()) t.join();
+    threads_.clear();
+
+    std::lock_guard lock(mutex_);
+    done_.clear();
+}
+
+void ReplicationWorkers::run()
+{
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock lock(mutex_);
+            cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (stopping_)
+                return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+
+        Continuation cont;
+        try {
+            cont = task.job();
+        } catch (const std::exception& e) {
+            cont = [fail = std::move(task.fail), what = std::string(e.what())] { fail(what); };
+        } catch (...) {
+            cont = [fail = std::move(task.fail)] { fail("unknown error"); };
+        }
+
+        {
+            std::lock_guard lock(mutex_);
+            if (stopping_)
+                return;
+            done_.push_back(std::move(cont));
+        }
+
+        // Wake the loop
+        if (event_fd_ >= 0) {
+            std::uint64_t one = 1;
+            [[maybe_unused]] ssize_t n = ::write(event_fd_, &one, sizeof(one));
+        }
+    }
+}
+
+// --- ReplicationCapture ------------------------------------------------------
+
+ReplicationCapture::ReplicationCapture(const std::string& path)
+    : out_(path, std::ios::binary | std::ios::app)
+{
+    if (out_.is_open())
+        thread_ = std::thread([this] { run(); });
+}
+
+ReplicationCapture::~ReplicationCapture()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_one();
+
+    if (thread_.joinable())
+        thread_.join();
+}
+
+bool ReplicationCapture::append(ReplicationCycle cycle)
+{
+    {
+        std::lock_guard lock(mutex_);
+        if (stopping_ || !thread_.joinable() || queue_.size() >= max_queue_)
+            return false;
+        queue_.push_back(std::move(cycle));
+    }
+    cv_.notify_one();
+    return true;
+}
+
+void ReplicationCapture::run()
+{
+    for (;;) {
+        ReplicationCycle cycle;
+        {
+            std::unique_lock lock(mutex_);
+            cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;  // stopping, everything written
+            cycle = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        write(cycle);
+    }
+}
+
+void ReplicationCapture::write(const ReplicationCycle& cycle)
+{
+    nlohmann::json meta = {
+        {"ts",             cycle.started_ms},
+        {"channel",        cycle.channel},
+        {"status",         cycle.status},
+        {"entries_out",    cycle.entries_out},
+        {"request_bytes",  cycle.request.size()},
+        {"response_bytes", cycle.response.size()},
+        {"us", {
+            {"outbox",   cycle.outbox_us},
+            {"build",    cycle.build_us},
+            {"transfer", cycle.transfer_us},
+            {"parse",    cycle.parse_us},
+            {"fetch",    cycle.fetch_us},
+            {"apply",    cycle.apply_us}
+        }}
+    };
+    if (!cycle.error.empty())
+        meta["error"] = cycle.error;
+
+    out_ << meta.dump() << '\n';
+    out_.write(cycle.request.data(), static_cast<std::streamsize>(cycle.request.size()));
+    out_.write(cycle.response.data(), static_cast<std::streamsize>(cycle.response.size()));
+    out_ << '\n';
+    out_.flush();
+}
+
+// --- ReplicationReplay -------------------------------------------------------
+
+ReplicationReplay::ReplicationReplay(const std::string& path)
+    : in_(path, std::ios::binary)
+{
+}
+
+bool ReplicationReplay::next(ReplicationCycle& cycle)
+{
+    std::string line;
+    if (!std::getline(in_, line) || line.empty())
+        return false;
+
+    try {
+        auto meta = nlohmann::json::parse(line);
+
+        cycle = {};
+        cycle.started_ms  = meta.value("ts", std::int64_t(0));
+        cycle.channel     = meta.value("channel", "");
+        cycle.status      = meta.value("status", 0);
+        cycle.entries_out = meta.value("entries_out", std::size_t(0));
+        cycle.error       = meta.value("error", "");
+
+        auto us = meta.value("us", nlohmann::json::object());
+        cycle.outbox_us   = us.value("outbox", std::int64_t(0));
+        cycle.build_us    = us.value("build", std::int64_t(0));
+        cycle.transfer_us = us.value("transfer", std::int64_t(0));
+        cycle.parse_us    = us.value("parse", std::int64_t(0));
+        cycle.fetch_us    = us.value("fetch", std::int64_t(0));
+        cycle.apply_us    = us.value("apply", std::int64_t(0));
+
+        cycle.request.resize(meta.value("request_bytes", std::size_t(0)));
+        cycle.response.resize(meta.value("response_bytes", std::size_t(0)));
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    in_.read(cycle.request.data(), static_cast<std::streamsize>(cycle.request.size()));
+    in_.read(cycle.response.data(), static_cast<std::streamsize>(cycle.response.size()));
+    return static_cast<bool>(in_) && in_.get() == '\n';
+}
+
+// --- ReplicationStore --------------------------------------------------------
+
+ReplicationStore::ReplicationStore(std::string dir, std::uintmax_t max_bytes)
+    : dir_(std::move(dir))
+    , max_bytes_(max_bytes)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    open_ = std::filesystem::is_directory(dir_, ec);
+    if (!open_)
+        return;
+
+    // Account for what is already on disk; drop leftovers of interrupted writes
+    for (auto it = std::filesystem::recursive_directory_iterator(dir_, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file(ec))
+            continue;
+        if (it->path().extension() == ".tmp")
+            std::filesystem::remove(it->path(), ec);
+        else
+            size_ += it->file_size(ec);
+    }
+
+    std::lock_guard lock(mutex_);
+    evict();
+}
+
+std::string ReplicationStore::hash(std::string_view value)
+{
+    return sha256_hex(value);
+}
+
+std::string ReplicationStore::path_of(const std::string& hash) const
+{
+    // Two-level fan-out: <dir>/ab/abcdef...
+    return dir_ + "/" + hash.substr(0, 2) + "/" + hash;
+}
+
+std::string ReplicationStore::put(std::string_view value)
+{
+    auto h = hash(value);
+    write(h, value);
+    return h;
+}
+
+bool ReplicationStore::put(const std::string& hash, std::string_view value)
+{
+    if (hash.size() != 64 || hash != ReplicationStore::hash(value))
+        return false;
+
+    return write(hash, value);
+}
+
+bool ReplicationStore::write(const std::string& hash, std::string_view value)
+{
+    auto path = path_of(hash);
+
+    std::lock_guard lock(mutex_);
+
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec)) {
+        touch(path);
+        return true;
+    }
+
+    std::filesystem::create_directories(dir_ + "/" + hash.substr(0, 2), ec);
+
+    // Write + rename: readers never see a partial value
+    auto tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(value.data(), static_cast<std::streamsize>(value.size()));
+        if (!out)
+            return false;
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+        return false;
+
+    size_ += value.size();
+    evict();
+    return true;
+}
+
+void ReplicationStore::touch(const std::string& path) const
+{
+    // mtime = last use, for LRU eviction
+    std::error_code ec;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+}
+
+void ReplicationStore::evict()
+{
+    if (size_ <= max_bytes_)
+        return;
+
+    // Least recently used first, down to 90% of the limit
+    struct File
+    {
+        std::filesystem::file_time_type used;
+        std::uintmax_t size;
+        std::filesystem::path path;
+    };
+    std::vector<File> files;
+
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(dir_, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->is_regular_file(ec) && it->path().extension() != ".tmp")
+            files.push_back({it->last_write_time(ec), it->file_size(ec), it->path()});
+    }
+
+    std::sort(files.begin(), files.end(),
+              [](const File& a, const File& b) { return a.used < b.used; });
+
+    size_ = 0;
+    for (auto& f : files)
+        size_ += f.size;
+
+    auto target = max_bytes_ / 10 * 9;
+    for (auto& f : files) {
+        if (size_ <= target)
+            break;
+        if (std::filesystem::remove(f.path, ec))
+            size_ -= f.size;
+    }
+}
+
+std::optional<std::string> ReplicationStore::get(const std::string& hash) const
+{
+    if (hash.size() != 64 || hash.find_first_not_of("0123456789abcdef") != std::string::npos)
+        return std::nullopt;
+
+    auto path = path_of(hash);
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+        return std::nullopt;
+
+    std::string value((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    touch(path);
+    return value;
+}
+
 // --- load_config -------------------------------------------------------------
 
 void ReplicationServer::load_config(Application& app)
@@ -83,6 +874,32 @@ void ReplicationServer::load_config(Application& app)
     if (c.contains("drain_limit") && c["drain_limit"].is_number_unsigned())
         drain_limit_ = c["drain_limit"].get<std::size_t>();
 
+    if (c.contains("workers") && c["workers"].is_number_unsigned())
+        worker_threads_ = std::min(c["workers"].get<std::size_t>(), std::size_t(16));
+
+    if (c.contains("dedup") && c["dedup"].is_object()) {
+        auto& dd = c["dedup"];
+        if (dd.contains("enable") && dd["enable"].is_boolean())
+            dedup_enable_ = dd["enable"].get<bool>();
+        if (dd.contains("threshold") && dd["threshold"].is_number_unsigned())
+            dedup_threshold_ = std::max(dd["threshold"].get<std::size_t>(), std::size_t(128));
+        if (dd.contains("store") && dd["store"].is_string())
+            dedup_dir_ = dd["store"].get<std::string>();
+        if (dd.contains("max_mb") && dd["max_mb"].is_number_unsigned())
+            dedup_max_mb_ = std::max(dd["max_mb"].get<std::size_t>(), std::size_t(1));
+    }
+
+    if (c.contains("capture") && c["capture"].is_string())
+        capture_file_ = c["capture"].get<std::string>();
+
+    if (c.contains("replay") && c["replay"].is_object()) {
+        auto& rp = c["replay"];
+        if (rp.contains("file") && rp["file"].is_string())
+            replay_file_ = rp["file"].get<std::string>();
+        if (rp.contains("speed") && rp["speed"].is_number())
+            replay_speed_ = std::max(0.0, rp["speed"].get<double>());
+    }
+
     if (c.contains("oauth2") && c["oauth2"].is_string()) {
         oauth2_file_ = c["oauth2"].get<std::string>();
 
@@ -134,6 +951,19 @@ void ReplicationServer::on_start(EventLoop& loop, Application& app)
     // Load config first (to populate source_ and cache remote oauth2 credentials)
     load_config(app);
 
+    // Worker pool for CPU-heavy sync stages (queue depth: one sync in flight,
+    // so a few slots are plenty; overflow falls back to the loop thread)
+    if (worker_threads_ > 0) {
+        workers_ = std::make_unique<ReplicationWorkers>(worker_threads_, worker_threads_ * 2);
+        if (workers_->event_fd() < 0) {
+            logger_->error("ReplicationServer: eventfd failed, running sync stages on the loop");
+            workers_.reset();
+        } else {
+            loop.add_io(workers_->event_fd(), EPOLLIN,
+                [this](std::uint32_t) { if (workers_) workers_->drain(); });
+        }
+    }
+
     // Determine source name (defaults to hostname)
     if (source_.empty()) {
         char hostname[256]{};
@@ -141,6 +971,17 @@ void ReplicationServer::on_start(EventLoop& loop, Application& app)
         source_ = hostname;
     }
 
+    if (dedup_enable_) {
+        store_ = std::make_unique<ReplicationStore>(dedup_dir_,
+                                                    std::uintmax_t(dedup_max_mb_) << 20);
+        if (!store_->is_open()) {
+            logger_->error("ReplicationServer: cannot open dedup store {}", dedup_dir_);
+            store_.reset();
+        }
+    }
+
+    open_capture_replay();
+
     // LISTEN for operator commands (mode/channel/sync)
     pool_->listen("replication_cmd",
         [this](std::string_view /*channel*/, std::string_view payload) {
@@ -167,11 +1008,12 @@ void ReplicationServer::heartbeat(std::chrono::system_clock::time_point now)
     if (!bot_->valid())
         return;
 
-    // 1. Refresh remote OAuth2 token (with backoff)
-    if (!token_valid() && status_ != Status::authenticating && now >= next_token_retry_)
+    // 1. Refresh remote OAuth2 token (with backoff); replay uses a mock master
+    if (replay_file_.empty() && !token_valid() && status_ != Status::authenticating
+        && now >= next_token_retry_)
         refresh_token();
 
-    if (!token_valid())
+    if (!remote_ready())
         return;
 
     if (status_ == Status::stopped)
@@ -195,6 +1037,22 @@ void ReplicationServer::heartbeat(std::chrono::system_clock::time_point now)
 
 void ReplicationServer::on_stop()
 {
+    if (workers_) {
+        if (loop_)
+            loop_->remove_io(workers_->event_fd());
+        workers_->stop();
+    }
+    workers_.reset();
+    store_.reset();
+    capture_.reset();
+    replay_.reset();
+    replay_pending_.reset();
+    if (replay_timer_fd_ >= 0) {
+        if (loop_)
+            loop_->remove_io(replay_timer_fd_);
+        ::close(replay_timer_fd_);
+        replay_timer_fd_ = -1;
+    }
     if (pool_)
         pool_->unlisten("replication_cmd");
     if (bot_)
@@ -306,7 +1164,7 @@ void ReplicationServer::handle_command(const std::string& cmd)
 
         if (action == "sync") {
             // Immediate sync request
-            if (!sync_in_progress_ && token_valid())
+            if (!sync_in_progress_ && remote_ready())
                 start_sync();
         } else if (action == "mode") {
             auto old = mode_;
@@ -336,13 +1194,29 @@ void ReplicationServer::handle_command(const std::string& cmd)
 
 void ReplicationServer::start_sync()
 {
-    if (master_url_.empty() || source_.empty()) {
+    if (replay_done_)
+        return;
+
+    if ((!replay_ && master_url_.empty()) || source_.empty()) {
         logger_->warn("ReplicationServer: master_url or source not configured");
         return;
     }
 
     sync_in_progress_ = true;
 
+    trace_ = {};
+    trace_.started_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    trace_.channel = channel_name(channel_);
+    cycle_started_ = std::chrono::steady_clock::now();
+    lap();
+
+    // Replay: outgoing batch comes from the recording, not the local outbox
+    if (replay_) {
+        replay_outbox();
+        return;
+    }
+
     // Step 1: Collect outgoing batch from local DB
     //
     // Fallback: uses existing api.replication_log(from, source, limit).
@@ -367,6 +1241,8 @@ void ReplicationServer::start_sync()
 
 void ReplicationServer::on_outbox_ready(std::vector<PgResult> results)
 {
+    trace_.outbox_us = lap();
+
     // results[0] = authorize, results[1] = replication_log
     if (results.size() < 2 || !results[1].ok()) {
         on_sync_error("Failed to read outbox");
@@ -377,31 +1253,56 @@ void ReplicationServer::on_outbox_ready(std::vector<PgResult> results)
 
     int rows = res.rows();
 
+    trace_.entries_out = static_cast<std::size_t>(rows);
+
     // Nothing to send — skip HTTP round-trip (important for satellite)
     if (rows == 0) {
+        trace_ = {};
         sync_in_progress_ = false;
         schedule_next_sync(false);
         return;
     }
 
-    // Build JSON payload
-    nlohmann::json payload;
-    payload["source"] = source_;
-    payload["entries"] = nlohmann::json::array();
+    // Build + dump JSON payload off the loop; PgResult owns its data, so the
+    // worker may read it after the connection has moved on.
+    auto data = std::make_shared<std::vector<PgResult>>(std::move(results));
+
+    offload([this, data, source = source_, store = store_.get(), refs = master_dedup_,
+             threshold = dedup_threshold_]() -> ReplicationWorkers::Continuation {
+        auto started = std::chrono::steady_clock::now();
+        auto body = build_payload((*data)[1], source, store, refs, threshold);
+        return [this, body = std::move(body), us = elapsed_us(started)]() mutable {
+            trace_.build_us = us;
+            post_sync(std::move(body));
+        };
+    });
+}
 
-    for (int r = 0; r < rows; ++r) {
-        nlohmann::json entry;
-        for (int c = 0; c < res.columns(); ++c) {
-            const char* col_name = res.column_name(c);
-            const char* val = res.value(r, c);
-            if (col_name && val)
-                entry[col_name] = val;
+void ReplicationServer::post_sync(std::string body)
+{
+    lap();
+    if (capture_)
+        trace_.request = body;
+
+    // Replay: mock master answers with the recorded response after the
+    // recorded transfer time (scaled by speed)
+    if (replay_) {
+        FetchResponse resp;
+        resp.status_code = replay_cycle_.status;
+        resp.body = replay_cycle_.response;
+        replay_pending_ = std::move(resp);
+
+        if (replay_speed_ <= 0) {
+            deliver_replay();
+            return;
         }
-        payload["entries"].push_back(std::move(entry));
+
+        arm_replay_timer(std::chrono::microseconds(
+            static_cast<std::int64_t>(replay_cycle_.transfer_us / replay_speed_)));
+        return;
     }
 
     // Step 2: POST to master
-    std::string body = payload.dump();
     std::string url = master_url_ + "/api/v1/replication/sync";
 
     std::vector<std::pair<std::string, std::string>> headers = {
@@ -419,25 +1320,175 @@ void ReplicationServer::on_outbox_ready(std::vector<PgResult> results)
 
 void ReplicationServer::on_sync_response(FetchResponse resp)
 {
+    trace_.transfer_us = lap();
+    trace_.status = resp.status_code;
+    if (capture_)
+        trace_.response = resp.body;
+
     if (resp.status_code < 200 || resp.status_code >= 300) {
         on_sync_error(fmt::format("HTTP {}: {}", resp.status_code,
                                   resp.body.substr(0, 256)));
         return;
     }
 
-    // Step 3: Parse response and apply incoming batch
-    nlohmann::json j;
-    try {
-        j = nlohmann::json::parse(resp.body);
-    } catch (const std::exception& e) {
-        on_sync_error(fmt::format("Cannot parse sync response: {}", e.what()));
+    // Step 3: Parse response and build apply SQL off the loop
+    offload([this, body = std::move(resp.body), session = bot_->session(),
+             source = source_, store = store_.get()]() -> ReplicationWorkers::Continuation {
+        auto started = std::chrono::steady_clock::now();
+
+        nlohmann::json j;
+        try {
+            j = nlohmann::json::parse(body);
+        } catch (const std::exception& e) {
+            return [this, error = fmt::format("Cannot parse sync response: {}", e.what())] {
+                on_sync_error(error);
+            };
+        }
+
+        auto entries = std::make_shared<nlohmann::json>(
+            j.value("entries", nlohmann::json::array()));
+        bool has_more = j.value("has_more", false);
+        bool dedup = j.value("dedup", false);  // master accepts refs
+
+        // Values the master lacks: upload them alongside this cycle
+        std::string upload;
+        if (store && j.contains("missing") && j["missing"].is_array()) {
+            nlohmann::json blobs = nlohmann::json::object();
+            for (auto& h : j["missing"]) {
+                if (!h.is_string())
+                    continue;
+                if (auto value = store->get(h.get<std::string>()))
+                    blobs[h.get<std::string>()] = std::move(*value);
+            }
+            if (!blobs.empty())
+                upload = nlohmann::json{{"source", source}, {"blobs", std::move(blobs)}}.dump();
+        }
+
+        if (entries->empty())
+            return [this, has_more, dedup, upload = std::move(upload),
+                    us = elapsed_us(started)]() mutable {
+                trace_.parse_us = us;
+                set_master_dedup(dedup);
+                post_blobs(std::move(upload));
+                apply_incoming({}, has_more);
+            };
+
+        // Values we lack: fetch them once, then apply
+        auto unresolved = resolve_refs(*entries, store);
+        if (!unresolved.empty())
+            return [this, entries, has_more, dedup, upload = std::move(upload),
+                    unresolved = std::move(unresolved), us = elapsed_us(started)]() mutable {
+                trace_.parse_us = us;
+                set_master_dedup(dedup);
+                post_blobs(std::move(upload));
+                fetch_blobs(std::move(unresolved), std::move(entries), has_more);
+            };
+
+        return [this, sql = build_apply_sql(*entries, session, source), has_more, dedup,
+                upload = std::move(upload), us = elapsed_us(started)]() mutable {
+            trace_.parse_us = us;
+            set_master_dedup(dedup);
+            post_blobs(std::move(upload));
+            apply_incoming(std::move(sql), has_more);
+        };
+    });
+}
+
+void ReplicationServer::set_master_dedup(bool supported)
+{
+    // Refs are only sent once the master has confirmed it resolves them
+    if (!store_ || supported == master_dedup_)
+        return;
+
+    master_dedup_ = supported;
+    logger_->notice("ReplicationServer: master {} deduplicated values",
+                    supported ? "accepts" : "no longer accepts");
+}
+
+void ReplicationServer::post_blobs(std::string body)
+{
+    // Best effort: the master asks again on the next cycle if this fails
+    if (body.empty() || replay_)
+        return;
+
+    std::string url = master_url_ + "/api/v1/replication/blobs";
+
+    std::vector<std::pair<std::string, std::string>> headers = {
+        {"Authorization", "Bearer " + access_token_},
+        {"Content-Type",  "application/json"}
+    };
+
+    fetch_->post(url, body, headers,
+        [this](FetchResponse resp) {
+            if (resp.status_code < 200 || resp.status_code >= 300)
+                logger_->warn("ReplicationServer: blob upload failed: HTTP {}", resp.status_code);
+        },
+        [this](std::string_view err) {
+            logger_->warn("ReplicationServer: blob upload failed: {}", err);
+        });
+}
+
+void ReplicationServer::fetch_blobs(std::vector<std::string> hashes,
+                                    std::shared_ptr<nlohmann::json> entries, bool has_more)
+{
+    if (replay_) {
+        on_sync_error(fmt::format("{} content refs not in local store (replay)", hashes.size()));
         return;
     }
 
-    auto entries = j.value("entries", nlohmann::json::array());
-    bool has_more = j.value("has_more", false);
+    lap();
+    std::string url = master_url_ + "/api/v1/replication/blobs/fetch";
+    std::string body = nlohmann::json{{"source", source_}, {"hashes", std::move(hashes)}}.dump();
+
+    std::vector<std::pair<std::string, std::string>> headers = {
+        {"Authorization", "Bearer " + access_token_},
+        {"Content-Type",  "application/json"},
+        {"Accept-Encoding", "gzip"}
+    };
+
+    fetch_->post(url, body, headers,
+        [this, entries = std::move(entries), has_more](FetchResponse resp) {
+            trace_.fetch_us = lap();
 
-    if (entries.empty()) {
+            if (resp.status_code < 200 || resp.status_code >= 300) {
+                on_sync_error(fmt::format("Blob fetch: HTTP {}: {}", resp.status_code,
+                                          resp.body.substr(0, 256)));
+                return;
+            }
+
+            offload([this, entries, has_more, body = std::move(resp.body),
+                     session = bot_->session(), source = source_,
+                     store = store_.get()]() -> ReplicationWorkers::Continuation {
+                auto j = nlohmann::json::parse(body);
+                auto blobs = j.value("blobs", nlohmann::json::object());
+
+                // Keep verified values for later cycles; drop mismatches
+                for (auto it = blobs.begin(); it != blobs.end();) {
+                    bool ok = it->is_string()
+                        && (store ? store->put(it.key(), it->get<std::string>())
+                                  : ReplicationStore::hash(it->get<std::string>()) == it.key());
+                    it = ok ? std::next(it) : blobs.erase(it);
+                }
+
+                auto unresolved = resolve_refs(*entries, store, &blobs);
+                if (!unresolved.empty())
+                    return [this, n = unresolved.size()] {
+                        on_sync_error(fmt::format("{} content refs could not be resolved", n));
+                    };
+
+                return [this, sql = build_apply_sql(*entries, session, source), has_more]() mutable {
+                    apply_incoming(std::move(sql), has_more);
+                };
+            });
+        },
+        [this](std::string_view err) {
+            on_sync_error(std::string(err));
+        });
+}
+
+void ReplicationServer::apply_incoming(std::string sql, bool has_more)
+{
+    if (sql.empty()) {
         // Nothing to apply -- sync done
         last_sync_ = std::chrono::system_clock::now();
         last_error_.clear();
@@ -447,30 +1498,11 @@ void ReplicationServer::on_sync_response(FetchResponse resp)
         schedule_next_sync(has_more);
 
         logger_->notice("ReplicationServer: sync completed, no incoming entries");
+        finish_cycle();
         return;
     }
 
-    // Apply incoming batch using existing api.add_to_relay_log + api.replication_apply
-    // When replication.apply_batch() is available, switch to that.
-    std::string sql = fmt::format("SELECT * FROM api.authorize({});\n",
-                                  pq_quote_literal(bot_->session()));
-    for (auto& entry : entries) {
-        sql += fmt::format(
-            "SELECT * FROM api.add_to_relay_log({}, {}, {}::timestamptz, "
-            "{}::char, {}, {}, {}::jsonb, {}::jsonb, false);\n",
-            pq_quote_literal(entry.value("source", source_)),
-            entry.value("id", 0),
-            pq_quote_literal(entry.value("datetime", "")),
-            pq_quote_literal(entry.value("action", "")),
-            pq_quote_literal(entry.value("schema", "")),
-            pq_quote_literal(entry.value("name", "")),
-            pq_quote_literal(entry.value("key", "null")),
-            pq_quote_literal(entry.value("data", "null")));
-    }
-
-    sql += fmt::format("SELECT * FROM api.replication_apply({});\n",
-                       pq_quote_literal(source_));
-
+    lap();
     pool_->execute(sql,
         [this, has_more](std::vector<PgResult> results) {
             on_apply_done(std::move(results));
@@ -497,6 +1529,9 @@ void ReplicationServer::on_apply_done(std::vector<PgResult> results)
     }
 
     logger_->notice("ReplicationServer: sync completed, applied {} entries", applied);
+
+    trace_.apply_us = lap();
+    finish_cycle();
 }
 
 void ReplicationServer::on_sync_error(const std::string& error)
@@ -513,10 +1548,17 @@ void ReplicationServer::on_sync_error(const std::string& error)
         current_interval() * (1 << std::min(consecutive_errors_, std::size_t(4))),
         seconds(1800));
     next_sync_ = std::chrono::system_clock::now() + backoff;
+
+    trace_.error = error;
+    finish_cycle();
 }
 
 void ReplicationServer::schedule_next_sync(bool has_more)
 {
+    // Replay follows the recorded schedule (see advance_replay)
+    if (replay_)
+        return;
+
     if (has_more) {
         // Fast drain: more data available, sync again in 5 seconds
         next_sync_ = std::chrono::system_clock::now() + seconds(5);
@@ -525,6 +1567,238 @@ void ReplicationServer::schedule_next_sync(bool has_more)
     }
 }
 
+// --- Capture / replay --------------------------------------------------------
+
+void ReplicationServer::open_capture_replay()
+{
+    // Capturing into the file being replayed would feed replay its own output
+    if (!capture_file_.empty() && !replay_file_.empty()) {
+        std::error_code ec;
+        auto same = std::filesystem::weakly_canonical(capture_file_, ec)
+                 == std::filesystem::weakly_canonical(replay_file_, ec);
+        if (same) {
+            logger_->warn("ReplicationServer: capture file {} is the replay file, capture disabled",
+                          capture_file_);
+            capture_file_.clear();
+        }
+    }
+
+    if (!capture_file_.empty()) {
+        capture_ = std::make_unique<ReplicationCapture>(capture_file_);
+        if (capture_->is_open()) {
+            logger_->notice("ReplicationServer: capturing sync cycles to {}", capture_file_);
+        } else {
+            logger_->error("ReplicationServer: cannot open capture file {}", capture_file_);
+            capture_.reset();
+        }
+    }
+
+    if (replay_file_.empty())
+        return;
+
+    // A replay that cannot start stays idle: never sync with the real master
+    // from a replay config
+    auto stay_idle = [this] {
+        replay_done_ = true;
+        mode_ = SyncMode::paused;
+    };
+
+    replay_ = std::make_unique<ReplicationReplay>(replay_file_);
+    if (!replay_->is_open()) {
+        logger_->error("ReplicationServer: cannot open replay file {}, staying idle", replay_file_);
+        replay_.reset();
+        stay_idle();
+        return;
+    }
+
+    if (!replay_->next(replay_cycle_)) {
+        logger_->warn("ReplicationServer: replay file {} is empty", replay_file_);
+        stay_idle();
+        return;
+    }
+
+    replay_timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (replay_timer_fd_ < 0) {
+        logger_->error("ReplicationServer: timerfd failed, replay disabled, staying idle");
+        replay_.reset();
+        stay_idle();
+        return;
+    }
+    loop_->add_io(replay_timer_fd_, EPOLLIN, [this](std::uint32_t) { on_replay_timer(); });
+
+    // First cycle starts from heartbeat (once the local session is valid);
+    // the rest are paced by the replay timer
+    mode_ = SyncMode::automatic;
+    next_sync_ = std::chrono::system_clock::now();
+    logger_->notice("ReplicationServer: replaying {} (speed={})", replay_file_, replay_speed_);
+}
+
+void ReplicationServer::replay_outbox()
+{
+    offload([this, request = replay_cycle_.request, source = source_, store = store_.get(),
+             refs = master_dedup_, threshold = dedup_threshold_]() -> ReplicationWorkers::Continuation {
+        auto started = std::chrono::steady_clock::now();
+        RecordedOutbox outbox(request, store);
+        auto outbox_us = elapsed_us(started);
+
+        // Refs the store no longer has (evicted): the batch would not be the
+        // recorded workload
+        if (outbox.unresolved() > 0)
+            return [this, n = outbox.unresolved()] {
+                on_sync_error(fmt::format("replay: {} recorded refs missing from store", n));
+            };
+
+        started = std::chrono::steady_clock::now();
+        auto body = build_payload(outbox, source, store, refs, threshold);
+
+        return [this, body = std::move(body), outbox_us, rows = outbox.rows(),
+                us = elapsed_us(started)]() mutable {
+            trace_.outbox_us = outbox_us;
+            trace_.entries_out = static_cast<std::size_t>(rows);
+            trace_.build_us = us;
+            post_sync(std::move(body));
+        };
+    });
+}
+
+void ReplicationServer::arm_replay_timer(std::chrono::microseconds delay)
+{
+    // it_value of zero disarms a timerfd -- fire after at least 1us
+    auto us = std::max<std::int64_t>(1, delay.count());
+
+    itimerspec spec{};
+    spec.it_value.tv_sec  = static_cast<time_t>(us / 1000000);
+    spec.it_value.tv_nsec = static_cast<long>(us % 1000000) * 1000;
+    ::timerfd_settime(replay_timer_fd_, 0, &spec, nullptr);
+}
+
+void ReplicationServer::on_replay_timer()
+{
+    std::uint64_t expirations;
+    [[maybe_unused]] ssize_t n = ::read(replay_timer_fd_, &expirations, sizeof(expirations));
+
+    // Mock master response due
+    if (replay_pending_) {
+        deliver_replay();
+        return;
+    }
+
+    // Next recorded cycle due
+    if (sync_in_progress_ || replay_done_ || !replay_)
+        return;
+
+    if (bot_ && bot_->valid())
+        start_sync();
+    else
+        next_sync_ = std::chrono::system_clock::now();  // let heartbeat retry
+}
+
+std::int64_t ReplicationServer::lap()
+{
+    auto now = std::chrono::steady_clock::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - phase_mark_).count();
+    phase_mark_ = now;
+    return us;
+}
+
+void ReplicationServer::deliver_replay()
+{
+    auto resp = std::move(*replay_pending_);
+    replay_pending_.reset();
+
+    // Recorded transport error: replay it as such
+    if (resp.status_code == 0) {
+        trace_.transfer_us = lap();
+        on_sync_error(replay_cycle_.error.empty() ? "replayed transport error"
+                                                  : replay_cycle_.error);
+        return;
+    }
+
+    on_sync_response(std::move(resp));
+}
+
+void ReplicationServer::finish_cycle()
+{
+    if (trace_.started_ms == 0)
+        return;
+
+    if (replay_ && !replay_done_) {
+        ++replay_cycles_;
+        add_phases(replay_actual_, trace_);
+        add_phases(replay_recorded_, replay_cycle_);
+
+        // outbox is an in-memory rebuild here, not the recorded DB read:
+        // reported, but not compared
+        logger_->notice("ReplicationServer: replay #{}: build {}us ({}), parse {}us ({}), "
+                        "fetch {}us ({}), apply {}us ({}); rebuild {}us",
+                        replay_cycles_,
+                        trace_.build_us,  replay_cycle_.build_us,
+                        trace_.parse_us,  replay_cycle_.parse_us,
+                        trace_.fetch_us,  replay_cycle_.fetch_us,
+                        trace_.apply_us,  replay_cycle_.apply_us,
+                        trace_.outbox_us);
+
+        advance_replay();
+    }
+
+    // Written by the capture thread, off the loop
+    if (capture_ && !capture_->append(std::move(trace_)))
+        logger_->warn("ReplicationServer: capture writer behind, cycle record dropped");
+
+    trace_ = {};
+}
+
+void ReplicationServer::advance_replay()
+{
+    auto prev_ms = replay_cycle_.started_ms;
+
+    if (!replay_->next(replay_cycle_)) {
+        replay_done_ = true;
+        mode_ = SyncMode::paused;
+
+        logger_->notice("ReplicationServer: replay finished, {} cycles; totals (recorded): "
+                        "build {}us ({}), parse {}us ({}), fetch {}us ({}), apply {}us ({})",
+                        replay_cycles_,
+                        replay_actual_.build_us, replay_recorded_.build_us,
+                        replay_actual_.parse_us, replay_recorded_.parse_us,
+                        replay_actual_.fetch_us, replay_recorded_.fetch_us,
+                        replay_actual_.apply_us, replay_recorded_.apply_us);
+        return;
+    }
+
+    // Keep the recorded start-to-start gap (scaled) on the replay timer. The
+    // gap includes the cycle that just ran, so subtract its elapsed time to
+    // avoid drifting; overrides error backoff, heartbeat no longer starts cycles.
+    auto gap_us = std::max<std::int64_t>(0, replay_cycle_.started_ms - prev_ms) * 1000;
+    auto delay_us = replay_speed_ > 0
+        ? static_cast<std::int64_t>(gap_us / replay_speed_) - elapsed_us(cycle_started_)
+        : 0;
+
+    next_sync_ = time_point::max();
+    arm_replay_timer(std::chrono::microseconds(std::max<std::int64_t>(0, delay_us)));
+}
+
+// --- Workers -----------------------------------------------------------------
+
+void ReplicationServer::offload(ReplicationWorkers::Job job)
+{
+    ReplicationWorkers::Fail fail = [this](std::string error) { on_sync_error(error); };
+
+    // Moves the job (and its captured payload) only when accepted
+    if (workers_ && workers_->submit(job, fail))
+        return;
+
+    // No pool or queue full: run the stage inline on the loop
+    try {
+        if (auto cont = job())
+            cont();
+    } catch (const std::exception& e) {
+        fail(e.what());
+    } catch (...) {
+        fail("unknown error");
+    }
+}
+
 // --- on_fatal ----------------------------------------------------------------
 
 void ReplicationServer::on_fatal(const std::string& error)
@@ -7,10 +7,20 @@
 #include "apostol/pg.hpp"
 #include "apostol/fetch_client.hpp"
 
+#include <nlohmann/json_fwd.hpp>
+
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 namespace apostol
@@ -20,6 +30,188 @@ class Application;
 class EventLoop;
 class Logger;
 
+// --- ReplicationWorkers ------------------------------------------------------
+//
+// Small bounded thread pool for the CPU-heavy stages of a sync cycle
+// (payload build + dump, response parse, apply SQL generation).
+//
+// A job runs on a worker thread and returns a continuation. Continuations are
+// queued back and executed on the EventLoop thread by drain(); event_fd() (an
+// eventfd) becomes readable whenever a continuation is queued, so the loop can
+// drain right away. Jobs must not touch ReplicationServer state -- copy
+// everything they need into the closure.
+//
+class ReplicationWorkers
+{
+public:
+    using Continuation = std::function<void()>;
+    using Job          = std::function<Continuation()>;
+    using Fail         = std::function<void(std::string)>;
+
+    ReplicationWorkers(std::size_t threads, std::size_t max_queue);
+    ~ReplicationWorkers();
+
+    ReplicationWorkers(const ReplicationWorkers&) = delete;
+    ReplicationWorkers& operator=(const ReplicationWorkers&) = delete;
+
+    /// Queue a job. Returns false if the queue is full or the pool is stopped;
+    /// job and fail are moved from only when the job is accepted, so the
+    /// caller can still run it inline. If the job throws, fail(what) is
+    /// queued as its continuation.
+    bool submit(Job& job, Fail& fail);
+
+    /// Readable when continuations are pending; register it on the EventLoop.
+    int event_fd() const { return event_fd_; }
+
+    /// Run finished continuations on the calling (loop) thread.
+    std::size_t drain();
+
+    /// Join workers. Pending jobs and continuations are discarded.
+    void stop();
+
+private:
+    struct Task
+    {
+        Job  job;
+        Fail fail;
+    };
+
+    void run();
+
+    std::vector<std::thread>  threads_;
+    std::deque<Task>          tasks_;
+    std::deque<Continuation>  done_;
+    std::mutex                mutex_;
+    std::condition_variable   cv_;
+    std::size_t               max_queue_;
+    int                       event_fd_{-1};
+    bool                      stopping_{false};
+};
+
+// --- ReplicationCycle --------------------------------------------------------
+//
+// One sync cycle as seen by the capture/replay machinery: payloads, outcome,
+// link characteristics and per-phase timings (microseconds).
+//
+struct ReplicationCycle
+{
+    std::int64_t started_ms{0};    // wall clock, ms since epoch
+    std::string  channel;          // lan | wifi | satellite
+    std::string  request;          // outgoing payload (as sent)
+    std::string  response;         // response body (as received)
+    int          status{0};        // HTTP status, 0 = transport error
+    std::size_t  entries_out{0};
+    std::string  error;
+
+    std::int64_t outbox_us{0};     // start_sync -> on_outbox_ready (replay: rebuild)
+    std::int64_t build_us{0};      // payload build + dump
+    std::int64_t transfer_us{0};   // POST -> response
+    std::int64_t parse_us{0};      // response parse + apply SQL generation
+    std::int64_t fetch_us{0};      // blob fetch round-trip (dedup), if any
+    std::int64_t apply_us{0};      // apply SQL round-trip
+};
+
+// --- ReplicationCapture ------------------------------------------------------
+//
+// Append-only capture file. One record per cycle:
+//
+//   <meta JSON>\n<request bytes><response bytes>\n
+//
+// meta holds everything except the bodies, plus "request_bytes" and
+// "response_bytes". Bodies are stored raw (no JSON escaping) to stay compact.
+//
+// Records are written by a dedicated thread (in order), so the EventLoop never
+// blocks on disk; pending records are flushed on destruction.
+//
+class ReplicationCapture
+{
+public:
+    explicit ReplicationCapture(const std::string& path);
+    ~ReplicationCapture();
+
+    ReplicationCapture(const ReplicationCapture&) = delete;
+    ReplicationCapture& operator=(const ReplicationCapture&) = delete;
+
+    bool is_open() const { return out_.is_open(); }
+
+    /// Queue a cycle for writing. Returns false (record dropped) if the
+    /// writer is too far behind.
+    bool append(ReplicationCycle cycle);
+
+private:
+    void run();
+    void write(const ReplicationCycle& cycle);
+
+    static constexpr std::size_t max_queue_ = 16;
+
+    std::ofstream                 out_;
+    std::thread                   thread_;
+    std::deque<ReplicationCycle>  queue_;
+    std::mutex                    mutex_;
+    std::condition_variable       cv_;
+    bool                          stopping_{false};
+};
+
+// --- ReplicationReplay -------------------------------------------------------
+//
+// Sequential reader for files written by ReplicationCapture.
+//
+class ReplicationReplay
+{
+public:
+    explicit ReplicationReplay(const std::string& path);
+
+    bool is_open() const { return in_.is_open(); }
+
+    /// Read the next record. Returns false at EOF or on a malformed record.
+    bool next(ReplicationCycle& cycle);
+
+private:
+    std::ifstream in_;
+};
+
+// --- ReplicationStore --------------------------------------------------------
+//
+// Content-addressed value store (one file per value, named by its SHA-256).
+//
+// Large field values are sent as hash references; the store keeps their
+// content so the peer can request missing values and incoming references can
+// be resolved locally. Safe to use from worker threads.
+//
+// Size is bounded by max_bytes: file mtime tracks last use, and the least
+// recently used values are evicted (down to 90%) when the limit is exceeded.
+// An evicted value is simply re-stored when it is sent or fetched again.
+//
+class ReplicationStore
+{
+public:
+    ReplicationStore(std::string dir, std::uintmax_t max_bytes);
+
+    bool is_open() const { return open_; }
+
+    static std::string hash(std::string_view value);
+
+    /// Store value under its own hash; returns the hash.
+    std::string put(std::string_view value);
+
+    /// Store value received from a peer. Returns false if the hash does not match.
+    bool put(const std::string& hash, std::string_view value);
+
+    std::optional<std::string> get(const std::string& hash) const;
+
+private:
+    std::string path_of(const std::string& hash) const;
+    bool write(const std::string& hash, std::string_view value);
+    void touch(const std::string& path) const;
+    void evict();   // mutex_ held
+
+    std::string    dir_;
+    std::uintmax_t max_bytes_;
+    std::uintmax_t size_{0};
+    bool           open_{false};
+    std::mutex     mutex_;
+};
+
 // --- ReplicationServer -------------------------------------------------------
 //
 // Background process module that synchronizes data between Apostol CRM nodes.
@@ -44,6 +236,24 @@ class Logger;
 //   3. Apply incoming batch:     replication.apply_batch(source, entries)
 //   4. Update watermarks:        replication.ack(source, ids)
 //
+// Capture/replay (opt-in): "capture" appends every cycle (payloads, timings,
+// channel) to a file; "replay" feeds such a file back through the sync cycle
+// against the local DB: recorded outgoing batches are rebuilt and run through
+// the regular build stage, a mock master answers from the recording, and a
+// timerfd on the loop paces cycles and responses at recorded or accelerated
+// speed. Per-phase timings are logged against the recorded ones.
+//
+// Deduplication (opt-in, "dedup"): fields of the row image (data/key jsonb)
+// above a size threshold are sent as {"refs": {"data.<field>": sha256}} and
+// kept in a bounded local ReplicationStore. Refs are only sent after the
+// master has answered a sync with "dedup": true; until then values go inline.
+// The master lists hashes it lacks in "missing"; they are uploaded to
+// master/replication/blobs. Incoming refs are resolved from the store, unknown
+// ones fetched once via master/replication/blobs/fetch before apply.
+//
+// CPU-heavy stages (JSON build/dump, response parse, apply SQL generation) run
+// on ReplicationWorkers; results are handed back to the loop via its eventfd.
+//
 // Fallback: uses existing db-platform API functions when new ones are unavailable.
 //
 // Configuration (in apostol.json):
@@ -57,6 +267,10 @@ class Logger;
 //       "interval": { "lan": 30, "wifi": 60, "satellite": 300 },
 //       "batch_limit": 500,
 //       "drain_limit": 1000,
+//       "workers": 2,
+//       "capture": "replication.capture",
+//       "replay": { "file": "vessel-aurora.capture", "speed": 1.0 },
+//       "dedup": { "enable": true, "threshold": 4096, "store": "replication.store", "max_mb": 256 },
 //       "oauth2": "replication.json"
 //     }
 //   }
@@ -88,6 +302,7 @@ private:
 
     std::unique_ptr<BotSession>  bot_;    // local DB auth (apibot)
     std::unique_ptr<FetchClient> fetch_;
+    std::unique_ptr<ReplicationWorkers> workers_;  // offloaded sync stages
 
     Status   status_{Status::stopped};
     SyncMode mode_{SyncMode::automatic};
@@ -114,6 +329,34 @@ private:
     std::size_t  consecutive_errors_{0};
     std::size_t  batch_limit_{500};
     std::size_t  drain_limit_{1000};
+    std::size_t  worker_threads_{2};   // 0 = run everything on the loop
+
+    // Deduplication (content-addressed store)
+    std::unique_ptr<ReplicationStore> store_;
+    bool         dedup_enable_{false};
+    std::size_t  dedup_threshold_{4096};   // bytes
+    std::string  dedup_dir_{"replication.store"};
+    std::size_t  dedup_max_mb_{256};       // store size limit (LRU eviction)
+    bool         master_dedup_{false};     // master confirmed refs support
+
+    // Capture / replay
+    using steady_point = std::chrono::steady_clock::time_point;
+
+    std::unique_ptr<ReplicationCapture> capture_;
+    std::unique_ptr<ReplicationReplay>  replay_;
+    std::string      capture_file_;
+    std::string      replay_file_;
+    double           replay_speed_{1.0};   // 0 = as fast as possible
+    ReplicationCycle trace_;               // current cycle
+    steady_point     phase_mark_{};
+    steady_point     cycle_started_{};     // start of the current cycle
+    ReplicationCycle replay_cycle_;        // recorded cycle being replayed
+    bool             replay_done_{false};
+    std::optional<FetchResponse> replay_pending_;  // mock master response
+    int              replay_timer_fd_{-1};  // paces replay (timerfd on the loop)
+    std::size_t      replay_cycles_{0};
+    ReplicationCycle replay_actual_;       // phase totals, this run
+    ReplicationCycle replay_recorded_;     // phase totals, recording
 
     // Interval per channel (seconds)
     seconds interval_lan_{30};
@@ -130,12 +373,14 @@ private:
     int max_priority() const;
     static SyncMode parse_mode(std::string_view s);
     static Channel  parse_channel(std::string_view s);
+    static std::string_view channel_name(Channel c);
 
     // -- Remote OAuth2 --------------------------------------------------------
     void refresh_token();
     void on_token_response(FetchResponse resp);
     void on_token_error(std::string_view error);
     bool token_valid() const;
+    bool remote_ready() const;
 
     // -- Drain slot -> outbox -------------------------------------------------
     void drain_slot();
@@ -148,12 +393,31 @@ private:
     // -- Sync -----------------------------------------------------------------
     void start_sync();
     void on_outbox_ready(std::vector<PgResult> results);
+    void post_sync(std::string body);
     void on_sync_response(FetchResponse resp);
+    void apply_incoming(std::string sql, bool has_more);
+    void set_master_dedup(bool supported);
+    void post_blobs(std::string body);
+    void fetch_blobs(std::vector<std::string> hashes,
+                     std::shared_ptr<nlohmann::json> entries, bool has_more);
     void on_apply_done(std::vector<PgResult> results);
     void on_sync_error(const std::string& error);
 
     void schedule_next_sync(bool has_more = false);
 
+    // -- Capture / replay -----------------------------------------------------
+    void open_capture_replay();
+    std::int64_t lap();
+    void finish_cycle();
+    void replay_outbox();
+    void arm_replay_timer(std::chrono::microseconds delay);
+    void on_replay_timer();
+    void deliver_replay();
+    void advance_replay();
+
+    // -- Workers --------------------------------------------------------------
+    void offload(ReplicationWorkers::Job job);
+
     // -- Logging --------------------------------------------------------------
     void on_fatal(const std::string& error);
 };